@@ -15,6 +15,9 @@
 #include <stdbool.h>
 
 #include "ring_buffer.h"
+#include "cli_watch.h"
+#include "cli_edit.h"
+#include "cli_store.h"
 #include "cli_const.h"
 uint32_t __cli_primask;
 
@@ -23,11 +26,13 @@ uint32_t __cli_primask;
 
 #define PRINT_PROMPT() printf("%s", CLI_PROMPT)
 #define FSM_TRANSIT(__DESTINATION__) do {\
+    _ctx->stats.transitions++; \
     _ctx->prev_state = _ctx->state; \
     _ctx->state = __DESTINATION__;} while (0)
 
 #define FSM_REVERT() do {\
     volatile CLI_State_t _state = _ctx->state; \
+    _ctx->stats.transitions++; \
     _ctx->state = _ctx->prev_state; \
     _ctx->prev_state = _state;} while (0)
 
@@ -39,6 +44,7 @@ uint32_t __cli_primask;
 #define STDIN_FILENO 1
 #define STDERR_FILENO 2
 #define CLI_OVFL_TIMEOUT_MAX -1
+#define MUX_ESC 0x10
 
 #ifndef CLI_PROMPT 
     #define CLI_PROMPT "> "
@@ -57,6 +63,13 @@ typedef enum {
     CLI_ERROR_RUNTIME
 } CLI_Status_t;
 
+typedef enum {
+    CLI_CH_SHELL,
+    CLI_CH_LOG,
+    CLI_CH_TELEMETRY,
+    CLI_CHANNELS
+} CLI_Channel_t;
+
 typedef struct {
     char *command;
     CLI_Status_t (*func)(int argc, char *argv[]); 
@@ -82,22 +95,45 @@ typedef struct {
     //char hist[MAX_HISTORY][MAX_LINE_LEN]; // Yes, static memory allocation
     //uint8_t _hist_index;
     struct {
-        uint8_t line[MAX_LINE_LEN];
-        uint8_t *cursor_position;
+        LineEdit_t edit;
+        RingBuffer_t rx; // Received, but not yet edited bytes
         uint8_t input;
     } ribbon;
 
     struct {
         CLI_Command_t commands[MAX_COMMANDS];
         uint32_t num_commands;
+        char *line_end; // End of the line being executed, see CLI_Execute
     } cmd;
 
     struct {
         UART_HandleTypeDef *huart;
         RingBuffer_t buffer;
         uint8_t chunk[CHUNK_SIZE];
-        bool tx_pend;
+        uint32_t since[CLI_CHANNELS]; // Tick when the oldest data in each queue was written
     } uart;
+
+    struct {
+        uint32_t writes; // _write calls
+        uint32_t transfers; // HAL_UART_Transmit_IT calls
+        uint32_t criticals; // Critical sections entered by CLI itself
+        uint32_t transitions; // FSM_TRANSIT and FSM_REVERT calls
+    } stats;
+
+#ifdef CLI_MUX
+    struct {
+        RingBuffer_t queue[CLI_CHANNELS - 1]; // Shell uses uart.buffer
+        int16_t deficit[CLI_CHANNELS]; // Negative after overdraft
+        uint8_t current; // Channel being served
+        uint8_t tx_channel; // Channel the receiver is switched to
+        uint32_t dropped; // Statistics, log bytes dropped on overflow
+    } mux;
+#endif
+
+    Watch_t watch;
+#ifdef CLI_STORE
+    Store_t store;
+#endif
 } CLI_Context_t;
 
 /* Handlers */
@@ -116,12 +152,17 @@ void _loop(void);
 CLI_Status_t CLI_RUN(CLI_Context_t *ctx, void loop(void));
 CLI_Status_t CLI_AddCommand(CLI_Context_t *ctx, char cmd[], CLI_Status_t (*func)(int argc, char *argv[]), \
     char help[]);
+CLI_Status_t CLI_AddWatch(CLI_Context_t *ctx, char name[], volatile void *addr, Watch_Type_t type);
+const char *CLI_GetConfig(CLI_Context_t *ctx, char key[]);
+CLI_Status_t CLI_SetConfig(CLI_Context_t *ctx, char key[], char value[]);
 
 /* HIgh-level IO */
 
 void CLI_Println(CLI_Context_t *ctx, char message[]);
 void CLI_Log(CLI_Context_t *ctx, char context[], char message[]);
 void CLI_Print(CLI_Context_t *ctx, char message[]);
+void CLI_Flush(CLI_Context_t *ctx);
+int CLI_Write(CLI_Context_t *ctx, CLI_Channel_t channel, uint8_t *data, int size);
 char *CLI_Status2Str(CLI_Status_t status);
 
 /* Callbacks */
@@ -9,12 +9,24 @@
 #define MAX_COMMANDS 64
 #define MAX_ARGUMENTS 10
 #define CHUNK_SIZE 64
-#define MAX_BUFFER_LEN 16
+#define MAX_BUFFER_LEN 128 // At least CHUNK_SIZE, so that writes are coalesced
 #define MAX_HISTORY 8
+#define MAX_WATCHES 8 // No more than 32
+#define WATCH_FRAME_LEN 128
+#define WATCH_KEYFRAME_PERIOD 16 // frames
+#define WATCH_DEFAULT_PERIOD 100 // ticks
+#define STORE_FLASH_ADDR 0x08007800 // Two last pages, must be excluded from linker script
+#define STORE_PAGE_SIZE 1024
 
 #define CLI_OVFL_PEND_TIMEOUT CLI_OVFL_TIMEOUT_MAX // ticks
+#define CLI_COALESCE_TIMEOUT 10 // ticks
+#define MUX_QUANTUM_SHELL 32 // bytes per round, see CLI_MUX
+#define MUX_QUANTUM_LOG 16
+#define MUX_QUANTUM_TELEMETRY 16
 
 /* Preferences */
 
 #define CLI_DISPLAY_GREETING
-#define CLI_OVERFLOW_PENDING
\ No newline at end of file
+#define CLI_OVERFLOW_PENDING
+//#define CLI_STORE // Erases STORE_FLASH_ADDR pages, exclude them in linker script first
+//#define CLI_MUX // Needs demultiplexer on host side, see tools/demux.py
@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * \file
+ * \brief Line editor with VT100 output.
+ */
+#include <stm32f1xx.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include "cli_const.h"
+
+/* Magic numbers */
+
+#define EDIT_ECHO_LEN (MAX_LINE_LEN + 16)
+
+/* Types */
+
+typedef enum {
+    EDIT_OK,
+    EDIT_ENTER,
+    EDIT_FULL,
+    EDIT_NULL
+} LineEdit_Status_t;
+
+typedef enum {
+    EDIT_ESC_NONE,
+    EDIT_ESC_START, // Got \033
+    EDIT_ESC_CSI,   // Got \033[
+    EDIT_ESC_SS3    // Got \033O
+} LineEdit_Escape_t;
+
+typedef struct {
+    uint8_t line[MAX_LINE_LEN];
+    unsigned int len;
+    unsigned int cursor;
+
+    LineEdit_Escape_t esc;
+    unsigned int esc_param;
+
+    uint8_t echo[EDIT_ECHO_LEN]; // Output produced by the last keystroke
+    unsigned int echo_len;
+    unsigned int echo_pos;
+} LineEdit_t;
+
+/* Basic functions */
+
+LineEdit_Status_t LineEdit_Init(LineEdit_t *edit);
+LineEdit_Status_t LineEdit_Clear(LineEdit_t *edit);
+LineEdit_Status_t LineEdit_Feed(LineEdit_t *edit, uint8_t input);
@@ -0,0 +1,67 @@
+#pragma once
+
+/**
+ * \file
+ * \brief Persistent key-value log in flash: config entries, aliases, macros.
+ */
+#ifdef STORE_HOST_FILE
+#include <stdint.h>
+#else
+#include <stm32f1xx.h>
+#endif
+#include <stdbool.h>
+#include "cli_const.h"
+
+/* Magic numbers */
+
+#define STORE_MAGIC 0xB55E
+#define STORE_HEADER_LEN 4
+#define STORE_EMPTY 0xFF
+
+/* Types */
+
+typedef enum {
+    STORE_CONFIG = 0x01,
+    STORE_ALIAS = 0x02,
+    STORE_MACRO = 0x03
+} Store_Type_t;
+
+typedef enum {
+    STORE_OK,
+    STORE_FULL,
+    STORE_NOT_FOUND,
+    STORE_ERROR,
+    STORE_NULL
+} Store_Status_t;
+
+typedef struct {
+    bool loaded;
+    bool broken; // Torn record found, log must be compacted before appending
+    uint8_t page; // Active page
+    uint16_t generation;
+    unsigned int end; // Offset of free space in active page
+
+    struct {
+        uint32_t requested; // Bytes of keys and values asked to be written
+        uint32_t programmed; // Bytes actually programmed, including compaction
+        uint32_t erases;
+        uint32_t load_time; // ns, cycle counter resolution
+    } stats;
+} Store_t;
+
+/* Basic functions */
+
+Store_Status_t Store_Init(Store_t *store);
+Store_Status_t Store_Load(Store_t *store);
+const char *Store_Get(Store_t *store, Store_Type_t type, const char *key);
+Store_Status_t Store_Put(Store_t *store, Store_Type_t type, const char *key, const char *value);
+
+/* Advanced operations */
+
+Store_Status_t Store_Compact(Store_t *store);
+unsigned int Store_Next(Store_t *store, Store_Type_t type, unsigned int offset, \
+    const char **key, const char **value);
+
+/* Getters/setters */
+
+unsigned int Store_GetFree(Store_t *store);
@@ -0,0 +1,77 @@
+#pragma once
+
+/**
+ * \file
+ * \brief Variable watch list and telemetry frame encoder.
+ */
+#include <stm32f1xx.h>
+#include <stdbool.h>
+#include "cli_const.h"
+
+/* Magic numbers */
+
+#define WATCH_SYNC_DELTA 0xA5
+#define WATCH_SYNC_KEY 0xA6
+
+/* Types */
+
+typedef enum {
+    WATCH_U8,
+    WATCH_I8,
+    WATCH_U16,
+    WATCH_I16,
+    WATCH_U32,
+    WATCH_I32,
+    WATCH_F32
+} Watch_Type_t;
+
+typedef enum {
+    WATCH_TEXT,
+    WATCH_BINARY
+} Watch_Mode_t;
+
+typedef enum {
+    WATCH_OK,
+    WATCH_FULL,
+    WATCH_NOT_FOUND,
+    WATCH_UNALIGNED,
+    WATCH_NULL
+} Watch_Status_t;
+
+typedef struct {
+    char *name;
+    volatile void *addr;
+    Watch_Type_t type;
+    uint32_t last; // Last value sent, raw bits
+} Watch_Var_t;
+
+typedef struct {
+    Watch_Var_t vars[MAX_WATCHES];
+    uint32_t num_vars;
+    uint32_t mask; // Variables selected for streaming
+
+    volatile bool active;
+    Watch_Mode_t mode;
+    uint32_t period;
+    uint32_t last_tick;
+    uint8_t seq;
+
+    uint8_t frame[WATCH_FRAME_LEN];
+    unsigned int frame_len;
+    unsigned int frame_pos;
+} Watch_t;
+
+/* Basic functions */
+
+Watch_Status_t Watch_Init(Watch_t *watch);
+Watch_Status_t Watch_Register(Watch_t *watch, char name[], volatile void *addr, Watch_Type_t type);
+Watch_Status_t Watch_Select(Watch_t *watch, char name[]);
+
+/* Advanced operations */
+
+unsigned int Watch_Sample(Watch_t *watch);
+
+/* Getters/setters */
+
+unsigned int Watch_GetTypeSize(Watch_Type_t type);
+char *Watch_Type2Str(Watch_Type_t type);
@@ -10,6 +10,16 @@ static CLI_Context_t *_ctx;
 
 #define MIN(a, b) ((a < b) ? a : b)
 
+/**
+ * \brief CLI_CRITICAL, counted in ctx->stats. The macro itself stays usable
+ * outside of this file, where _ctx is not visible.
+ */
+static inline void CLI_EnterCritical(void)
+{
+    CLI_CRITICAL();
+    _ctx->stats.criticals++;
+}
+
 /* Handlers */
 
 /* These functions are used to handle built-in commands. To add your own
@@ -41,9 +51,201 @@ static CLI_Status_t err_Handler(int argc, char *argv[])
     return CLI_ERROR;
 }
 
+#ifdef CLI_STORE
+
+/**
+ * \brief Get the rest of the line being executed, starting from the argument,
+ * with original separators. Unlike argv, it is not limited by MAX_ARGUMENTS.
+ * \param[in] from Index of the first argument.
+ * \retval Pointer to the rest of the line, NULL if there is no such argument.
+ * \details Arguments after argv[from] are joined into it, so they must not be
+ *  used afterwards.
+ */
+static char *get_rest(int argc, char *argv[], int from)
+{
+    if (from >= argc || argv[from] == NULL) return NULL;
+    char *end = _ctx->cmd.line_end;
+    for (char *p = argv[from]; p < end; p++) {
+        if (*p == '\0') *p = ' ';
+    }
+    while (end > argv[from] && end[-1] == ' ') end--;
+    *end = '\0';
+    return argv[from];
+}
+
+static bool store_type(char *name, Store_Type_t *type)
+{
+    if (strcmp(name, "set") == 0) {
+        *type = STORE_CONFIG;
+    } else if (strcmp(name, "alias") == 0) {
+        *type = STORE_ALIAS;
+    } else if (strcmp(name, "macro") == 0) {
+        *type = STORE_MACRO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static CLI_Status_t store_Status2Cli(Store_Status_t status)
+{
+    switch (status) {
+        case STORE_OK:
+            return CLI_OK;
+        case STORE_FULL:
+        case STORE_NOT_FOUND:
+            return CLI_ERROR_ARG;
+        default:
+            return CLI_ERROR_RUNTIME;
+    }
+}
+
+/*
+Usage: set|alias|macro [<name> [<value> ...]]
+Without arguments lists entries, with name only prints its value,
+otherwise stores the rest of the line as the value.
+Macro value is a list of commands separated by ';'.
+*/
+
+static CLI_Status_t store_Handler(int argc, char *argv[])
+{
+    Store_t *store = &_ctx->store;
+    Store_Type_t type;
+    const char *key, *value;
+    if (!store_type(argv[0], &type)) return CLI_ERROR_ARG;
+
+    if (argc < 2 || argv[1] == NULL) {
+        unsigned int offset = 0;
+        while ((offset = Store_Next(store, type, offset, &key, &value)) != 0) {
+            printf("%s\t%s\n", key, value);
+        }
+        return CLI_OK;
+    }
+    if (argc < 3 || argv[2] == NULL) {
+        value = Store_Get(store, type, argv[1]);
+        if (value == NULL) return CLI_ERROR_ARG;
+        printf("%s\n", value);
+        return CLI_OK;
+    }
+
+    return store_Status2Cli(Store_Put(store, type, argv[1], get_rest(argc, argv, 2)));
+}
+
+/*
+Usage: unset set|alias|macro <name>
+*/
+
+static CLI_Status_t unset_Handler(int argc, char *argv[])
+{
+    Store_Type_t type;
+    if (argc < 3 || argv[1] == NULL || argv[2] == NULL) return CLI_ERROR_ARG;
+    if (!store_type(argv[1], &type)) return CLI_ERROR_ARG;
+    return store_Status2Cli(Store_Put(&_ctx->store, type, argv[2], NULL));
+}
+
+/*
+Usage: store [compact]
+Prints log usage and write statistics.
+*/
+
+static CLI_Status_t storage_Handler(int argc, char *argv[])
+{
+    Store_t *store = &_ctx->store;
+    if (argc > 1 && argv[1] != NULL) {
+        if (strcmp(argv[1], "compact") != 0) return CLI_ERROR_ARG;
+        return store_Status2Cli(Store_Compact(store));
+    }
+    unsigned int free_space = Store_GetFree(store);
+    printf("page\t%u\ngeneration\t%u\nfree\t%u\nrequested\t%lu\nprogrammed\t%lu\n" \
+        "erases\t%lu\nload time\t%lu ns\n", store->page, store->generation, free_space, \
+        (unsigned long)store->stats.requested, (unsigned long)store->stats.programmed, \
+        (unsigned long)store->stats.erases, (unsigned long)store->stats.load_time);
+    return CLI_OK;
+}
+
+#endif
+
+/*
+Usage: watch [<period> [text|bin] [name ...]]
+Without arguments lists registered variables. Otherwise starts streaming
+selected (or all, if none specified) variables every <period> ticks,
+until Ctrl+C is pressed.
+*/
+
+static CLI_Status_t watch_Handler(int argc, char *argv[])
+{
+    Watch_t *watch = &_ctx->watch;
+    if (argc < 2 || argv[1] == NULL) {
+        for (int i = 0; i < watch->num_vars; i++) {
+            printf("%s\t%s\n", watch->vars[i].name, Watch_Type2Str(watch->vars[i].type));
+        }
+        return CLI_OK;
+    }
+
+    if (watch->num_vars == 0) return CLI_ERROR_ARG; // Nothing to stream
+
+    char *end;
+    uint32_t period = strtoul(argv[1], &end, 10);
+    if (*end != '\0' || period == 0) return CLI_ERROR_ARG;
+
+    int i = 2;
+    Watch_Mode_t mode = WATCH_TEXT;
+    if (i < argc && argv[i] != NULL) {
+        if (strcmp(argv[i], "bin") == 0) {
+            mode = WATCH_BINARY;
+            i++;
+        } else if (strcmp(argv[i], "text") == 0) {
+            i++;
+        }
+    }
+
+    watch->mask = 0;
+    for (; i < argc && argv[i] != NULL; i++) {
+        if (Watch_Select(watch, argv[i]) != WATCH_OK) {
+            printf("Error: no such variable: %s\n", argv[i]);
+            return CLI_ERROR_ARG;
+        }
+    }
+    if (watch->mask == 0) watch->mask = (watch->num_vars < 32) ? \
+        (1UL << watch->num_vars) - 1 : 0xFFFFFFFF;
+
+    watch->mode = mode;
+    watch->period = period;
+    watch->seq = 0;
+    watch->frame_len = 0;
+    watch->frame_pos = 0;
+    watch->last_tick = HAL_GetTick() - period; // First frame right away
+    watch->active = true;
+    return CLI_OK;
+}
+
+/*
+Usage: stats [reset]
+Prints IO and state machine counters, see CLI_Context_t.stats.
+*/
+
+static CLI_Status_t stats_Handler(int argc, char *argv[])
+{
+    if (argc > 1 && argv[1] != NULL) {
+        if (strcmp(argv[1], "reset") != 0) return CLI_ERROR_ARG;
+        memset(&_ctx->stats, 0, sizeof(_ctx->stats));
+#ifdef CLI_MUX
+        _ctx->mux.dropped = 0;
+#endif
+        return CLI_OK;
+    }
+    printf("writes\t%lu\ntransfers\t%lu\ncriticals\t%lu\ntransitions\t%lu\n", \
+        (unsigned long)_ctx->stats.writes, (unsigned long)_ctx->stats.transfers, \
+        (unsigned long)_ctx->stats.criticals, (unsigned long)_ctx->stats.transitions);
+#ifdef CLI_MUX
+    printf("dropped\t%lu\n", (unsigned long)_ctx->mux.dropped);
+#endif
+    return CLI_OK;
+}
+
 __weak CLI_Status_t CLI_TimeoutHandler(CLI_Context_t *ctx)
 {
-    CLI_CRITICAL();
+    CLI_EnterCritical();
     RingBuffer_read(&ctx->uart.buffer, NULL, ctx->uart.buffer.size);
     FSM_TRANSIT(CLI_PROM_PEND);
     CLI_UNCRITICAL();
@@ -52,49 +254,320 @@ __weak CLI_Status_t CLI_TimeoutHandler(CLI_Context_t *ctx)
 /* Processing functions */
 
 /**
- * \brief Process CLI command, that is stored in _line array.
- * \retval returns command execution status and CLI_ERROR if command does not exist.
+ * \brief Find command by name.
+ * \retval Pointer to command or NULL if there is no such command.
  */
-static CLI_Status_t CLI_ProcessCommand(CLI_Context_t *ctx)
+static CLI_Command_t *CLI_FindCommand(CLI_Context_t *ctx, char *name)
+{
+    for (int i = 0; i < ctx->cmd.num_commands; i++) {
+        if (strcmp(name, ctx->cmd.commands[i].command) == 0) {
+            return &ctx->cmd.commands[i];
+        }
+    }
+    return NULL;
+}
+
+static CLI_Status_t CLI_Execute(CLI_Context_t *ctx, char *line, bool expand);
+
+#ifdef CLI_STORE
+
+/**
+ * \brief Run alias: its value with the rest of the line appended.
+ * \retval CLI_ERROR_ARG if the expanded line does not fit into MAX_LINE_LEN.
+ */
+static CLI_Status_t CLI_RunAlias(CLI_Context_t *ctx, const char *value, int argc, char *argv[])
+{
+    char line[MAX_LINE_LEN];
+    char *rest = get_rest(argc, argv, 1);
+    int len = (rest != NULL) ? snprintf(line, MAX_LINE_LEN, "%s %s", value, rest) : \
+        snprintf(line, MAX_LINE_LEN, "%s", value);
+    if (len < 0 || len >= MAX_LINE_LEN) return CLI_ERROR_ARG;
+    return CLI_Execute(ctx, line, false);
+}
+
+/**
+ * \brief Run macro: commands separated by ';', stops at the first error.
+ */
+static CLI_Status_t CLI_RunMacro(CLI_Context_t *ctx, const char *value)
+{
+    char line[MAX_LINE_LEN];
+    strncpy(line, value, MAX_LINE_LEN - 1);
+    line[MAX_LINE_LEN - 1] = '\0';
+
+    char *save;
+    for (char *part = strtok_r(line, ";", &save); part; part = strtok_r(NULL, ";", &save)) {
+        CLI_Status_t _status = CLI_Execute(ctx, part, false);
+        if (_status != CLI_OK) return _status;
+    }
+    return CLI_OK;
+}
+
+#endif
+
+/**
+ * \brief Split line into arguments and run the command.
+ * \param[in] expand Whether aliases and macros are looked up. They are not expanded
+ *  recursively.
+ * \retval Command execution status and CLI_ERROR if command does not exist.
+ */
+static CLI_Status_t CLI_Execute(CLI_Context_t *ctx, char *line, bool expand)
 {
-    /*
-        TODO: switch from strtok to strtok_r
-    */
     int argc = 0;
     char *argv[MAX_ARGUMENTS];
-    CLI_CRITICAL();
-    argv[argc++] = strtok((char*)ctx->ribbon.line, " ");
-    while ((argv[argc++] = strtok(NULL, " ")) && argc < MAX_ARGUMENTS) ;
-    CLI_UNCRITICAL();
+    char *save;
+    ctx->cmd.line_end = line + strlen(line);
+    argv[argc++] = strtok_r(line, " ", &save);
+    while ((argv[argc++] = strtok_r(NULL, " ", &save)) && argc < MAX_ARGUMENTS) ;
 
-    CLI_Command_t curr_cmd;
-    for (int i = 0; i < ctx->cmd.num_commands; i++) {
-        curr_cmd = ctx->cmd.commands[i];
-        if (strcmp(argv[0], curr_cmd.command) == 0) {
-            CLI_Status_t _status = curr_cmd.func(argc, argv);
-            FSM_TRANSIT(CLI_PROM_PEND);
-            return _status;
+    if (argv[0] == NULL) return CLI_OK; // Empty line
+
+    CLI_Command_t *curr_cmd = CLI_FindCommand(ctx, argv[0]);
+    if (curr_cmd != NULL) return curr_cmd->func(argc, argv);
+
+#ifdef CLI_STORE
+    if (expand) {
+        const char *value;
+        if ((value = Store_Get(&ctx->store, STORE_ALIAS, argv[0])) != NULL) {
+            return CLI_RunAlias(ctx, value, argc, argv);
+        }
+        if ((value = Store_Get(&ctx->store, STORE_MACRO, argv[0])) != NULL) {
+            return CLI_RunMacro(ctx, value);
         }
     }
+#endif
     printf("Error: command not found!\n");
-    CLI_CRITICAL();
+    return CLI_ERROR;
+}
+
+/**
+ * \brief Process CLI command, that is stored in the line editor.
+ * \retval returns command execution status and CLI_ERROR if command does not exist.
+ */
+static CLI_Status_t CLI_ProcessCommand(CLI_Context_t *ctx)
+{
+    CLI_UNCRITICAL(); // Commands print, so UART interrupts must be on
+    CLI_Status_t _status = CLI_Execute(ctx, (char*)ctx->ribbon.edit.line, true);
+    CLI_EnterCritical();
     FSM_TRANSIT(CLI_PROM_PEND);
     CLI_UNCRITICAL();
-    return CLI_ERROR;
+    return _status;
 }
 
 /**
- * \brief Transmits chunk of data of size CHUNK_SIZE.
- * \param[in] buffer_size current size of the buffer.
- * \retval HAL transmission status.
+ * \brief Get TX queue of the channel. Without CLI_MUX all channels share one queue.
  */
-static HAL_StatusTypeDef UART_TransmitChunk(CLI_Context_t *ctx, unsigned int buffer_size)
+static RingBuffer_t *UART_Queue(CLI_Context_t *ctx, CLI_Channel_t channel)
 {
-    CLI_CRITICAL();
-    RingBuffer_read(&ctx->uart.buffer, _ctx->uart.chunk, MIN(CHUNK_SIZE, buffer_size));
-    //FSM_TRANSIT(CLI_TRANSMITTING);
+#ifdef CLI_MUX
+    if (channel != CLI_CH_SHELL) return &ctx->mux.queue[channel - 1];
+#endif
+    return &ctx->uart.buffer;
+}
+
+#ifdef CLI_MUX
+
+static const uint16_t mux_quantum[CLI_CHANNELS] = {
+    MUX_QUANTUM_SHELL, MUX_QUANTUM_LOG, MUX_QUANTUM_TELEMETRY
+};
+
+/*
+Channels share UART with deficit round robin: each round a channel may send up
+to its quantum of bytes, so under full load each channel gets quantum/sum of
+the bandwidth, and the shell stays responsive while logs flood. When receiver
+must be switched to another channel, MUX_ESC and channel number are sent.
+MUX_ESC in data is sent twice. Deficit is charged for bytes on the wire, escapes
+and switches included, and overdraft is paid back from the next quantum, so
+escape-heavy data does not get more than its share.
+*/
+
+static unsigned int UART_FillChunk(CLI_Context_t *ctx)
+{
+    unsigned int len = 0;
+    int idle = 0; // Channels visited without sending anything
+    while (len + 4 <= CHUNK_SIZE && idle <= CLI_CHANNELS) { // Switch and escaped byte must fit
+        uint8_t channel = ctx->mux.current;
+        RingBuffer_t *queue = UART_Queue(ctx, channel);
+        if (RingBuffer_GetSize(queue) == 0 || ctx->mux.deficit[channel] <= 0) {
+            if (RingBuffer_GetSize(queue) == 0 && ctx->mux.deficit[channel] > 0) {
+                ctx->mux.deficit[channel] = 0; // No banking, but overdraft is kept
+            }
+            ctx->mux.current = (channel + 1) % CLI_CHANNELS;
+            ctx->mux.deficit[ctx->mux.current] += mux_quantum[ctx->mux.current];
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        unsigned int start = len;
+        if (ctx->mux.tx_channel != channel) {
+            ctx->uart.chunk[len++] = MUX_ESC;
+            ctx->uart.chunk[len++] = channel;
+            ctx->mux.tx_channel = channel;
+        }
+        uint8_t byte;
+        RingBuffer_pull(queue, &byte);
+        ctx->uart.chunk[len++] = byte;
+        if (byte == MUX_ESC) ctx->uart.chunk[len++] = byte;
+        ctx->mux.deficit[channel] -= len - start;
+    }
+    return len;
+}
+
+#else
+
+static unsigned int UART_FillChunk(CLI_Context_t *ctx)
+{
+    unsigned int len = MIN(CHUNK_SIZE, RingBuffer_GetSize(&ctx->uart.buffer));
+    RingBuffer_read(&ctx->uart.buffer, ctx->uart.chunk, len);
+    return len;
+}
+
+#endif
+
+/**
+ * \brief Transmits chunk of data of size up to CHUNK_SIZE. Must be called
+ * from TxCplt callback or with UART interrupts disabled.
+ * \retval Number of bytes sent, 0 if there was nothing to send.
+ */
+static unsigned int UART_TransmitChunk(CLI_Context_t *ctx)
+{
+    unsigned int len = UART_FillChunk(ctx);
+    if (len > 0) {
+        ctx->stats.transfers++;
+        HAL_UART_Transmit_IT(ctx->uart.huart, ctx->uart.chunk, len);
+    }
+    return len;
+}
+
+/**
+ * \brief Start transmission of the buffer if UART is idle. The rest of the buffer
+ * is sent by TxCplt callback.
+ */
+static void UART_Flush(CLI_Context_t *ctx)
+{
+    CLI_EnterCritical();
+    if (ctx->uart.huart->gState == HAL_UART_STATE_READY) {
+        UART_TransmitChunk(ctx);
+    }
     CLI_UNCRITICAL();
-    return HAL_UART_Transmit_IT(ctx->uart.huart, _ctx->uart.chunk, MIN(CHUNK_SIZE, buffer_size));
+}
+
+/**
+ * \brief Queue data for transmission without blocking.
+ * \param[in] channel Channel to send data to.
+ * \retval Number of bytes queued, may be less than size if the buffer is full.
+ * \details Data is coalesced: transmission is started only if there is a full
+ *  chunk in the buffer or data waits longer than CLI_COALESCE_TIMEOUT. Otherwise
+ *  it is started at the end of CLI_RUN, CLI_Print*, CLI_Log or by CLI_Flush.
+ */
+static unsigned int UART_Enqueue(CLI_Context_t *ctx, CLI_Channel_t channel, uint8_t *data, \
+    unsigned int size)
+{
+    RingBuffer_t *queue = UART_Queue(ctx, channel);
+    CLI_EnterCritical();
+    unsigned int buffer_size = RingBuffer_GetSize(queue);
+    /* Per queue, so that writes to other channels don't delay waiting data */
+    uint32_t *since = &ctx->uart.since[(queue == &ctx->uart.buffer) ? CLI_CH_SHELL : channel];
+    if (buffer_size == 0) *since = HAL_GetTick();
+    unsigned int len = MIN(size, MAX_BUFFER_LEN - buffer_size);
+    RingBuffer_write(queue, data, len);
+    buffer_size += len;
+    CLI_UNCRITICAL();
+
+    if (buffer_size >= MIN(CHUNK_SIZE, MAX_BUFFER_LEN) || \
+        HAL_GetTick() - *since >= CLI_COALESCE_TIMEOUT) {
+        UART_Flush(ctx);
+    }
+    return len;
+}
+
+/**
+ * \brief Sample watched variables and stream them.
+ * \details Never blocks: if TX buffer is full, the rest of the frame is sent
+ *  on the next iteration, and new samples are not taken until the frame is
+ *  gone. So the period is a lower bound, if the UART can't keep up.
+ */
+static void CLI_ProcessWatch(CLI_Context_t *ctx)
+{
+    Watch_t *watch = &ctx->watch;
+    if (watch->frame_pos < watch->frame_len) {
+        watch->frame_pos += UART_Enqueue(ctx, CLI_CH_TELEMETRY, watch->frame + watch->frame_pos, \
+            watch->frame_len - watch->frame_pos);
+        return;
+    }
+    if (!watch->active) return;
+
+    uint32_t tick = HAL_GetTick();
+    if (tick - watch->last_tick < watch->period) return;
+    watch->last_tick = tick;
+
+    Watch_Sample(watch);
+    watch->frame_pos += UART_Enqueue(ctx, CLI_CH_TELEMETRY, watch->frame, watch->frame_len);
+}
+
+/**
+ * \brief Check if stream is running or its last frame is still being sent,
+ * so the shell must wait.
+ */
+static bool CLI_WatchBusy(CLI_Context_t *ctx)
+{
+#ifdef CLI_MUX
+    UNUSED(ctx);
+    return false; // Stream has its own channel and runs in background
+#else
+    return ctx->watch.active || ctx->watch.frame_pos < ctx->watch.frame_len;
+#endif
+}
+
+/**
+ * \brief Feed received bytes to the line editor and send its output.
+ * \details Output of each keystroke is sent in one write. The next byte is not
+ *  processed until it is queued, so this never blocks. Moves FSM to
+ *  CLI_CMD_READY when the line is complete.
+ */
+static void CLI_ProcessInput(CLI_Context_t *ctx)
+{
+    LineEdit_t *edit = &ctx->ribbon.edit;
+    if (edit->echo_pos < edit->echo_len) {
+        edit->echo_pos += UART_Enqueue(ctx, CLI_CH_SHELL, edit->echo + edit->echo_pos, \
+            edit->echo_len - edit->echo_pos);
+        return;
+    }
+
+    CLI_EnterCritical();
+    CLI_State_t state = ctx->state;
+    CLI_UNCRITICAL();
+    if (state == CLI_CMD_READY || state == CLI_PROCESSING) return;
+
+    uint8_t input;
+    do { // Escape sequences produce no output until they are complete
+        CLI_EnterCritical();
+        RingBuffer_Status_t status = RingBuffer_pull(&ctx->ribbon.rx, &input);
+        CLI_UNCRITICAL();
+        if (status != RB_OK) return;
+
+        if (LineEdit_Feed(edit, input) == EDIT_ENTER) {
+            CLI_EnterCritical();
+            FSM_TRANSIT(CLI_CMD_READY);
+            CLI_UNCRITICAL();
+            break;
+        }
+    } while (edit->echo_len == 0);
+
+    edit->echo_pos += UART_Enqueue(ctx, CLI_CH_SHELL, edit->echo, edit->echo_len);
+}
+
+/**
+ * \brief Reprint the line being edited after the prompt (e. g. CLI_Println has
+ * interrupted it) and put terminal cursor back to its position.
+ */
+static void CLI_RedrawLine(CLI_Context_t *ctx)
+{
+    LineEdit_t *edit = &ctx->ribbon.edit;
+    edit->echo_pos = edit->echo_len; // Redraw supersedes the rest of the echo
+    if (edit->len == 0) return;
+    printf("%.*s", (int)edit->len, edit->line);
+    if (edit->len > edit->cursor) printf("\033[%uD", edit->len - edit->cursor);
 }
 
 /**
@@ -114,7 +587,7 @@ void _loop(void)
  */
 CLI_Status_t CLI_RUN(CLI_Context_t *ctx, void loop(void))
 {
-    CLI_CRITICAL();
+    CLI_EnterCritical();
     CLI_State_t state = ctx->state;
     CLI_UNCRITICAL();
 
@@ -122,7 +595,9 @@ CLI_Status_t CLI_RUN(CLI_Context_t *ctx, void loop(void))
         loop();
         //return CLI_OK;
     }
-    CLI_CRITICAL();
+    CLI_ProcessWatch(ctx);
+    CLI_ProcessInput(ctx);
+    CLI_EnterCritical();
 
     if (ctx->state == CLI_TIMEOUT) {
         CLI_TimeoutHandler(ctx);
@@ -132,60 +607,59 @@ CLI_Status_t CLI_RUN(CLI_Context_t *ctx, void loop(void))
     if (ctx->state == CLI_CMD_READY) {
         ctx->state = CLI_PROCESSING;
         _status = CLI_ProcessCommand(ctx);
-    } if (ctx->state == CLI_PROM_PEND) {
+        LineEdit_Clear(&ctx->ribbon.edit);
+    } if (ctx->state == CLI_PROM_PEND && !CLI_WatchBusy(ctx)) {
         PRINT_PROMPT();
+        CLI_RedrawLine(ctx);
         ctx->state = CLI_IDLE;
     }
     CLI_UNCRITICAL();
+    UART_Flush(ctx); // Everything printed during this iteration
     return _status;
 }
 
 /* Syscalls */
 
 /* 
-Syscall, called from printf. It is asynchronous (mostly) and works independently
-from the main loop. To avoid buffer overflow, define CLI_OVERFLOW_PENDING.
-The algorithm is as follows:
-    1. Check if UART is currently transmitting something. If so, write straight
-    to buffer. Overflow handling depends on user preferences (see below).
-    2. Attempt to transmit data chunk to UART. If UART is busy, attempt to write it
-    to buffer. What happends in case of overflow, depends on user preferences:
-        a. If  CLI_OVERFLOW_PENDING is defined, then the function will block
-        execution until there is enough space in buffer to write.
-        b. Otherwise, it will just fail.
-    3. If UART is not busy, set flag accurdingly.
+Syscall, called from printf. Output is coalesced, so that small writes are merged
+into full transfers. Data is copied into buffer, and transmission is started when:
+    1. There is a full chunk of CHUNK_SIZE bytes in the buffer;
+    2. Data has been waiting for CLI_COALESCE_TIMEOUT ticks (checked on writes);
+    3. CLI_RUN iteration ends, CLI_Print*, CLI_Log or CLI_Flush is called.
+The rest of the buffer is sent in chunks by TxCplt callback. What happends in case
+of overflow, depends on user preferences:
+    a. If  CLI_OVERFLOW_PENDING is defined, then the function will block
+    execution until there is enough space in buffer to write.
+    b. Otherwise, it will just fail.
 */
 
 static int write_pending(uint8_t *data, int size)
 {
-    CLI_CRITICAL();
-    int ms_start = HAL_GetTick();
-    CLI_UNCRITICAL();
+    uint32_t ms_start = HAL_GetTick();
+    int written = 0;
 
-    while (MAX_BUFFER_LEN - RingBuffer_GetSize(&_ctx->uart.buffer) < size) {
+    while ((written += UART_Enqueue(_ctx, CLI_CH_SHELL, data + written, size - written)) < size) {
+        UART_Flush(_ctx); // Buffer is full, make sure it's being emptied
         if (CLI_OVFL_PEND_TIMEOUT != CLI_OVFL_TIMEOUT_MAX && \
-            HAL_GetTick() - ms_start > CLI_OVFL_PEND_TIMEOUT) break;
-    }
-
-    CLI_CRITICAL();
-    if (RingBuffer_write(&_ctx->uart.buffer, data, size) != RB_OK) {
-        FSM_TRANSIT(CLI_TIMEOUT);
-        CLI_UNCRITICAL();
-        return -1;
+            HAL_GetTick() - ms_start > CLI_OVFL_PEND_TIMEOUT) {
+            CLI_EnterCritical();
+            FSM_TRANSIT(CLI_TIMEOUT);
+            CLI_UNCRITICAL();
+            return -1;
+        }
     }
-    CLI_UNCRITICAL();
+    return size;
 }
 
 static int write_no_pending(uint8_t *data, int size)
 {
-    CLI_CRITICAL();
-    if (RingBuffer_write(&_ctx->uart.buffer, data, size) != RB_OK) {
-        FSM_TRANSIT(CLI_TIMEOUT);
-        CLI_UNCRITICAL();
-        return -1;
-    }
+    CLI_EnterCritical();
+    bool fits = MAX_BUFFER_LEN - RingBuffer_GetSize(&_ctx->uart.buffer) >= size;
+    if (!fits) FSM_TRANSIT(CLI_TIMEOUT);
     CLI_UNCRITICAL();
-    return size;
+
+    if (!fits) return -1;
+    return UART_Enqueue(_ctx, CLI_CH_SHELL, data, size);
 }
 
 int _write(int fd, uint8_t *data, int size)
@@ -193,41 +667,20 @@ int _write(int fd, uint8_t *data, int size)
     if (fd != STDIN_FILENO && fd != STDOUT_FILENO && fd != STDERR_FILENO) {
         return -1;
     }
+    _ctx->stats.writes++;
 
-    CLI_CRITICAL();
-    CLI_State_t _state = _ctx->state;
-    CLI_UNCRITICAL();
-
-    if (_state == CLI_TRANSMITTING) {
-#ifdef CLI_OVERFLOW_PENDING
-        int status = write_pending(data, size);
-        return MIN(size, status);
-#else
-        write_no_pending(data, size);
-#endif
+#ifdef CLI_MUX
+    if (fd == STDERR_FILENO) { // Log channel never blocks, overflow is dropped
+        int written = UART_Enqueue(_ctx, CLI_CH_LOG, data, size);
+        _ctx->mux.dropped += size - written;
+        return size;
     }
-
-    CLI_CRITICAL();
-    FSM_TRANSIT(CLI_TRANSMITTING);
-    CLI_UNCRITICAL();
-
-    CLI_CRITICAL();
-    HAL_StatusTypeDef status = HAL_UART_Transmit_IT(_ctx->uart.huart, data, size);
-    CLI_UNCRITICAL();
-
-    if (status != HAL_OK) {
+#endif
 #ifdef CLI_OVERFLOW_PENDING
-        int status = write_pending(data, size);
-        return MIN(size, status);
+    return write_pending(data, size);
 #else
-        write_no_pending(data, size);
+    return write_no_pending(data, size);
 #endif
-    } else {
-        CLI_CRITICAL();
-        FSM_REVERT();
-        CLI_UNCRITICAL();
-        return size;
-    }
 }
 
 int _isatty(int fd)
@@ -254,22 +707,46 @@ CLI_Status_t CLI_Init(CLI_Context_t *ctx, UART_HandleTypeDef *huart)
     if (HAL_UART_GetState(huart) != HAL_UART_STATE_READY) return CLI_ERROR;
     _ctx = ctx;
     ctx->uart.huart = huart;
-    ctx->ribbon.cursor_position = _ctx->ribbon.line;
+    LineEdit_Init(&ctx->ribbon.edit);
+    RingBuffer_Init(&ctx->ribbon.rx);
     RingBuffer_Init(&ctx->uart.buffer);
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+#ifdef CLI_MUX
+    for (int i = 0; i < CLI_CHANNELS - 1; i++) RingBuffer_Init(&ctx->mux.queue[i]);
+    memset(ctx->mux.deficit, 0, sizeof(ctx->mux.deficit));
+    ctx->mux.current = CLI_CH_SHELL;
+    ctx->mux.tx_channel = MUX_ESC; // Unknown, so the first byte switches receiver
+    ctx->mux.dropped = 0;
+#endif
     ctx->cmd.num_commands = 0;
+    Watch_Init(&ctx->watch);
+#ifdef CLI_STORE
+    Store_Init(&ctx->store); // Loaded on first use
+#endif
 
     ctx->state = CLI_IDLE; // Init state machine
 
     setvbuf(stdout, NULL, _IONBF, 0);
+    setvbuf(stderr, NULL, _IONBF, 0);
 
     CLI_AddCommand(ctx, "help", &help_Handler, "Prints this message.");
     CLI_AddCommand(ctx, "test", &test_Handler, "Simply prints it's arguments");
     CLI_AddCommand(ctx, "nop", &nop_Handler, "Does absolutely nothing.");
     CLI_AddCommand(ctx, "err", &err_Handler, "Returns CLI_ERROR, so should cause error.");
+    CLI_AddCommand(ctx, "watch", &watch_Handler, "watch [<period> [text|bin] [name ...]], Ctrl+C stops.");
+    CLI_AddCommand(ctx, "stats", &stats_Handler, "stats [reset], IO and state machine counters.");
+#ifdef CLI_STORE
+    CLI_AddCommand(ctx, "set", &store_Handler, "set [<key> [<value>]], persistent config.");
+    CLI_AddCommand(ctx, "alias", &store_Handler, "alias [<name> [<command>]], persistent alias.");
+    CLI_AddCommand(ctx, "macro", &store_Handler, "macro [<name> [<cmd>; <cmd> ...]], persistent macro.");
+    CLI_AddCommand(ctx, "unset", &unset_Handler, "unset set|alias|macro <name>");
+    CLI_AddCommand(ctx, "store", &storage_Handler, "store [compact], persistent storage info.");
+#endif
 #ifdef CLI_DISPLAY_GREETING
     printf("%s\n", CLI_GREETING);
 #endif
     printf(CLI_PROMPT);
+    UART_Flush(ctx);
 
     HAL_UART_Receive_IT(ctx->uart.huart, (uint8_t*)&_ctx->ribbon.input, 1);
     return CLI_OK;
@@ -294,18 +771,85 @@ CLI_Status_t CLI_AddCommand(CLI_Context_t *ctx, char cmd[], CLI_Status_t (*func)
     return CLI_OK;
 }
 
+/**
+ * \brief Adds variable to the watch list.
+ * \param[in] name Variable name.
+ * \param[in] addr Variable address.
+ * \param[in] type Variable type, defines its size.
+ * \retval CLI_ERROR if watches limit exceeded or address is not aligned to type size,
+ *  CLI_OK otherwise.
+ */
+CLI_Status_t CLI_AddWatch(CLI_Context_t *ctx, char name[], volatile void *addr, Watch_Type_t type)
+{
+    if (Watch_Register(&ctx->watch, name, addr, type) != WATCH_OK) return CLI_ERROR;
+    return CLI_OK;
+}
+
+/**
+ * \brief Get persistent config entry.
+ * \param[in] key Entry name.
+ * \retval Entry value or NULL if there is no such entry or CLI_STORE is off.
+ */
+const char *CLI_GetConfig(CLI_Context_t *ctx, char key[])
+{
+#ifdef CLI_STORE
+    return Store_Get(&ctx->store, STORE_CONFIG, key);
+#else
+    UNUSED(ctx); UNUSED(key);
+    return NULL; // Flash is not touched, store pages may hold firmware
+#endif
+}
+
+/**
+ * \brief Set persistent config entry.
+ * \param[in] key Entry name.
+ * \param[in] value Entry value, NULL to delete entry.
+ * \retval CLI_ERROR if entry could not be stored or CLI_STORE is off, CLI_OK otherwise.
+ */
+CLI_Status_t CLI_SetConfig(CLI_Context_t *ctx, char key[], char value[])
+{
+#ifdef CLI_STORE
+    if (Store_Put(&ctx->store, STORE_CONFIG, key, value) != STORE_OK) return CLI_ERROR;
+    return CLI_OK;
+#else
+    UNUSED(ctx); UNUSED(key); UNUSED(value);
+    return CLI_ERROR;
+#endif
+}
+
 /* High-level IO */
 
+/**
+ * \brief Write data to the channel without blocking.
+ * \param[in] channel Channel, to which data is written. Without CLI_MUX all
+ *  channels go to the same stream.
+ * \retval Number of bytes written, the rest is dropped if the queue is full.
+ */
+int CLI_Write(CLI_Context_t *ctx, CLI_Channel_t channel, uint8_t *data, int size)
+{
+    if (channel >= CLI_CHANNELS || size < 0) return -1;
+    return UART_Enqueue(ctx, channel, data, size);
+}
+
+/**
+ * \brief Start transmission of everything printed so far, without waiting
+ * for the end of CLI_RUN iteration.
+ */
+void CLI_Flush(CLI_Context_t *ctx)
+{
+    UART_Flush(ctx);
+}
+
 /**
  * \brief Print line and prompt.
  * \param[in] message Message text.
  */
 void CLI_Println(CLI_Context_t *ctx, char message[])
 {
-    printf("\n");
-    printf("%s\n", message);
+    printf("\n%s\n", message);
     if (_ctx->state != CLI_PROCESSING)
         FSM_TRANSIT(CLI_PROM_PEND);
+    UART_Flush(ctx); // Don't wait for the end of CLI_RUN
 }
 
 /**
@@ -315,10 +859,14 @@ void CLI_Println(CLI_Context_t *ctx, char message[])
  */
 void CLI_Log(CLI_Context_t *ctx, char context[], char message[])
 {
-    printf("\n");
-    printf("[%s] %s\n", context, message);
+#ifdef CLI_MUX
+    fprintf(stderr, "[%s] %s\n", context, message); // Log channel, shell is not disturbed
+#else
+    printf("\n[%s] %s\n", context, message);
     if (_ctx->state != CLI_PROCESSING)
         FSM_TRANSIT(CLI_PROM_PEND);
+#endif
+    UART_Flush(ctx);
 }
 
 /**
@@ -327,10 +875,10 @@ void CLI_Log(CLI_Context_t *ctx, char context[], char message[])
  */
 void CLI_Print(CLI_Context_t *ctx, char message[])
 {
-    printf("\r\n");
-    printf("%s", message);
+    printf("\r\n%s", message);
     if (_ctx->state != CLI_PROCESSING)
         FSM_TRANSIT(CLI_PROM_PEND);
+    UART_Flush(ctx);
 }
 
 char *CLI_Status2Str(CLI_Status_t _status)
@@ -364,13 +912,7 @@ If it is empty, then it will set the flag to RESET.
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
     if (huart->Instance == _ctx->uart.huart->Instance) {
-        unsigned int buffer_size = RingBuffer_GetSize(&_ctx->uart.buffer);
-
-        if (buffer_size > 0) {
-            UART_TransmitChunk(_ctx, buffer_size);
-        } else if (_ctx->state == CLI_TRANSMITTING) {
-            FSM_REVERT();
-        }
+        UART_TransmitChunk(_ctx);
     }
 }
 
@@ -388,22 +930,17 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
             /* Abhorrent, but will do; locks UART while command processing takes place */
             /* Could be written shorter with labels, but labels are Satan's creation */
         }
+        if (_ctx->ribbon.input == '\003') { // Ctrl+C stops streaming
+            _ctx->watch.active = false;
+        }
+        if (CLI_WatchBusy(_ctx)) {
+            HAL_UART_Receive_IT(_ctx->uart.huart, (uint8_t*)&_ctx->ribbon.input, 1);
+            return;
+        }
         FSM_TRANSIT(CLI_RECIEVING);
         switch (_ctx->ribbon.input) {
-            case '\n':
-                FSM_REVERT();
-                break;
-
-            case '\r':
-                *_ctx->ribbon.cursor_position = '\0';
-                _ctx->ribbon.cursor_position = _ctx->ribbon.line;
-                HAL_UART_Transmit_IT(_ctx->uart.huart, \
-                    (uint8_t*)"\n", 1);
-                FSM_TRANSIT(CLI_CMD_READY);
-                break;
-            
             case '\032': // Ctrl+z pauses the main loop
-                    CLI_CRITICAL();
+                    CLI_EnterCritical();
                     if (_ctx->prev_state == CLI_ON_HOLD) {
                         FSM_TRANSIT(CLI_PROM_PEND);
                     } else {
@@ -414,22 +951,8 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
                     break;
             
             default:
-                if (_ctx->ribbon.cursor_position - _ctx->ribbon.line < MAX_LINE_LEN && \
-                    _ctx->state != CLI_CMD_READY) {
-                    if (_ctx->ribbon.input == '\b') {
-                        if (_ctx->ribbon.cursor_position > _ctx->ribbon.line) {
-                            _ctx->ribbon.cursor_position--;
-                            //printf("\b"); // Backspace
-                            HAL_UART_Transmit_IT(_ctx->uart.huart, \
-                                (uint8_t*)"\b", 1);
-                        }
-                    } else {
-                        *_ctx->ribbon.cursor_position++ = _ctx->ribbon.input;
-                        //printf("%c", _ctx->ribbon.input); // Echo
-                        HAL_UART_Transmit_IT(_ctx->uart.huart, \
-                            (uint8_t*)&_ctx->ribbon.input, 1);
-                    }
-                }
+                /* Editing is done in CLI_RUN, input is dropped if it can't keep up */
+                RingBuffer_push(&_ctx->ribbon.rx, (uint8_t*)&_ctx->ribbon.input);
                 FSM_REVERT();
         }
         HAL_UART_Receive_IT(_ctx->uart.huart, (uint8_t*)&_ctx->ribbon.input, 1);
@@ -471,12 +994,26 @@ CLI_Status_t CLI_AddCommand(CLI_Context_t *ctx, char cmd[], CLI_Status_t (*func)
         return CLI_OK;
 }
 
+CLI_Status_t CLI_AddWatch(CLI_Context_t *ctx, char name[], volatile void *addr, Watch_Type_t type) {
+    UNUSED(ctx); UNUSED(name); UNUSED(addr); UNUSED(type);
+    return CLI_OK;
+}
+
+const char *CLI_GetConfig(CLI_Context_t *ctx, char key[]) {UNUSED(ctx); UNUSED(key); return NULL;}
+CLI_Status_t CLI_SetConfig(CLI_Context_t *ctx, char key[], char value[]) {
+    UNUSED(ctx); UNUSED(key); UNUSED(value);
+    return CLI_OK;
+}
+
 /* HIgh-level IO */
 
 void CLI_Println(CLI_Context_t *ctx, char message[]) {UNUSED(message); UNUSED(ctx);}
 void CLI_Log(CLI_Context_t *ctx, char context[], char message[]) 
     {UNUSED(ctx); UNUSED(context); UNUSED(message);}
 void CLI_Print(CLI_Context_t *ctx, char message[]) {UNUSED(ctx); UNUSED(message);}
+void CLI_Flush(CLI_Context_t *ctx) {UNUSED(ctx);}
+int CLI_Write(CLI_Context_t *ctx, CLI_Channel_t channel, uint8_t *data, int size)
+    {UNUSED(ctx); UNUSED(channel); UNUSED(data); return size;}
 char *CLI_Status2Str(CLI_Status_t _status) {UNUSED(_status);}
 void _loop(void);
 
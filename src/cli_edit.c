@@ -0,0 +1,281 @@
+#include "cli_edit.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Output functions */
+
+/* All output is accumulated in echo buffer, so that the whole keystroke
+is sent in one write. Terminal cursor is assumed to be at edit->cursor
+before each keystroke. */
+
+static void put(LineEdit_t *edit, const void *data, unsigned int len)
+{
+    if (edit->echo_len + len > EDIT_ECHO_LEN) len = EDIT_ECHO_LEN - edit->echo_len;
+    memcpy(edit->echo + edit->echo_len, data, len);
+    edit->echo_len += len;
+}
+
+/**
+ * \brief Move terminal cursor left, using whichever is shorter: backspaces or CSI.
+ */
+static void move_left(LineEdit_t *edit, unsigned int n)
+{
+    if (n == 0) return;
+    if (n <= 4) {
+        while (n--) put(edit, "\b", 1);
+        return;
+    }
+    char seq[12];
+    int len = snprintf(seq, sizeof(seq), "\033[%uD", n);
+    put(edit, seq, len);
+}
+
+/**
+ * \brief Move terminal cursor right from edit->cursor, reprinting characters
+ * if it's shorter than CSI.
+ */
+static void move_right(LineEdit_t *edit, unsigned int n)
+{
+    if (n == 0) return;
+    if (n <= 4) {
+        put(edit, edit->line + edit->cursor, n);
+        return;
+    }
+    char seq[12];
+    int len = snprintf(seq, sizeof(seq), "\033[%uC", n);
+    put(edit, seq, len);
+}
+
+/**
+ * \brief Reprint the line from position from (where terminal cursor is) to the end,
+ * then return cursor to edit->cursor.
+ * \param[in] erase Clear the tail, if line became shorter.
+ */
+static void redraw(LineEdit_t *edit, unsigned int from, bool erase)
+{
+    put(edit, edit->line + from, edit->len - from);
+    if (erase) put(edit, "\033[K", 3);
+    move_left(edit, edit->len - edit->cursor);
+}
+
+/* Editing functions */
+
+static LineEdit_Status_t insert(LineEdit_t *edit, uint8_t input)
+{
+    if (edit->len >= MAX_LINE_LEN - 1) return EDIT_FULL;
+    memmove(edit->line + edit->cursor + 1, edit->line + edit->cursor, edit->len - edit->cursor);
+    edit->line[edit->cursor] = input;
+    edit->len++;
+    edit->cursor++;
+    redraw(edit, edit->cursor - 1, false);
+    return EDIT_OK;
+}
+
+/**
+ * \brief Delete n characters before cursor.
+ */
+static void delete_before(LineEdit_t *edit, unsigned int n)
+{
+    if (n > edit->cursor) n = edit->cursor;
+    if (n == 0) return;
+    move_left(edit, n);
+    memmove(edit->line + edit->cursor - n, edit->line + edit->cursor, edit->len - edit->cursor);
+    edit->cursor -= n;
+    edit->len -= n;
+    redraw(edit, edit->cursor, true);
+}
+
+static void delete_at(LineEdit_t *edit)
+{
+    if (edit->cursor >= edit->len) return;
+    memmove(edit->line + edit->cursor, edit->line + edit->cursor + 1, edit->len - edit->cursor - 1);
+    edit->len--;
+    redraw(edit, edit->cursor, true);
+}
+
+static void delete_word(LineEdit_t *edit)
+{
+    unsigned int i = edit->cursor;
+    while (i > 0 && edit->line[i - 1] == ' ') i--;
+    while (i > 0 && edit->line[i - 1] != ' ') i--;
+    delete_before(edit, edit->cursor - i);
+}
+
+static void cursor_left(LineEdit_t *edit)
+{
+    if (edit->cursor == 0) return;
+    move_left(edit, 1);
+    edit->cursor--;
+}
+
+static void cursor_right(LineEdit_t *edit)
+{
+    if (edit->cursor >= edit->len) return;
+    move_right(edit, 1);
+    edit->cursor++;
+}
+
+static void cursor_home(LineEdit_t *edit)
+{
+    move_left(edit, edit->cursor);
+    edit->cursor = 0;
+}
+
+static void cursor_end(LineEdit_t *edit)
+{
+    move_right(edit, edit->len - edit->cursor);
+    edit->cursor = edit->len;
+}
+
+/**
+ * \brief Handle one byte of escape sequence. Supports arrows, Home, End and Delete
+ * in both CSI and SS3 forms.
+ */
+static void escape(LineEdit_t *edit, uint8_t input)
+{
+    switch (edit->esc) {
+        case EDIT_ESC_START:
+            edit->esc_param = 0;
+            if (input == '[') edit->esc = EDIT_ESC_CSI;
+            else if (input == 'O') edit->esc = EDIT_ESC_SS3;
+            else edit->esc = EDIT_ESC_NONE;
+            return;
+
+        case EDIT_ESC_CSI:
+            if (isdigit(input)) {
+                if (edit->esc_param < 100) edit->esc_param = edit->esc_param * 10 + input - '0';
+                return;
+            }
+            if (input == '~') {
+                switch (edit->esc_param) {
+                    case 1:
+                    case 7:
+                        cursor_home(edit);
+                        break;
+                    case 4:
+                    case 8:
+                        cursor_end(edit);
+                        break;
+                    case 3:
+                        delete_at(edit);
+                        break;
+                }
+                edit->esc = EDIT_ESC_NONE;
+                return;
+            }
+            /* Fall through, final bytes are the same */
+        case EDIT_ESC_SS3:
+            switch (input) {
+                case 'D':
+                    cursor_left(edit);
+                    break;
+                case 'C':
+                    cursor_right(edit);
+                    break;
+                case 'H':
+                    cursor_home(edit);
+                    break;
+                case 'F':
+                    cursor_end(edit);
+                    break;
+            }
+            /* Parameters are ignored, anything in 0x40-0x7E ends the sequence */
+            if (input >= 0x40 && input <= 0x7E) edit->esc = EDIT_ESC_NONE;
+            return;
+
+        default:
+            edit->esc = EDIT_ESC_NONE;
+    }
+}
+
+/* Basic functions */
+
+/**
+ * \brief Initialize line editor.
+ * \param[out] edit Line editor object.
+ */
+LineEdit_Status_t LineEdit_Init(LineEdit_t *edit)
+{
+    if (edit == NULL) return EDIT_NULL;
+    LineEdit_Clear(edit);
+    edit->echo_len = 0;
+    edit->echo_pos = 0;
+    return EDIT_OK;
+}
+
+/**
+ * \brief Clear the line, leaving pending output intact.
+ */
+LineEdit_Status_t LineEdit_Clear(LineEdit_t *edit)
+{
+    if (edit == NULL) return EDIT_NULL;
+    edit->line[0] = '\0';
+    edit->len = 0;
+    edit->cursor = 0;
+    edit->esc = EDIT_ESC_NONE;
+    return EDIT_OK;
+}
+
+/**
+ * \brief Process one input byte.
+ * \param[in] input Received byte.
+ * \retval EDIT_ENTER if line is complete (it is then null-terminated),
+ *  EDIT_FULL if line is too long, EDIT_OK otherwise.
+ * \details Terminal output is stored in edit->echo. It must be sent before
+ *  the next byte is fed, since it is overwritten.
+ */
+LineEdit_Status_t LineEdit_Feed(LineEdit_t *edit, uint8_t input)
+{
+    edit->echo_len = 0;
+    edit->echo_pos = 0;
+
+    if (edit->esc != EDIT_ESC_NONE) {
+        escape(edit, input);
+        return EDIT_OK;
+    }
+
+    switch (input) {
+        case '\r':
+            edit->line[edit->len] = '\0';
+            put(edit, "\n", 1);
+            return EDIT_ENTER;
+
+        case '\033':
+            edit->esc = EDIT_ESC_START;
+            break;
+
+        case '\b':
+        case 0x7F: // Some terminals send DEL on backspace
+            delete_before(edit, 1);
+            break;
+
+        case 0x17: // Ctrl+W
+            delete_word(edit);
+            break;
+
+        case 0x15: // Ctrl+U
+            delete_before(edit, edit->cursor);
+            break;
+
+        case 0x01: // Ctrl+A
+            cursor_home(edit);
+            break;
+
+        case 0x05: // Ctrl+E
+            cursor_end(edit);
+            break;
+
+        case 0x02: // Ctrl+B
+            cursor_left(edit);
+            break;
+
+        case 0x06: // Ctrl+F
+            cursor_right(edit);
+            break;
+
+        default:
+            if (isprint(input)) return insert(edit, input);
+            /* Other control characters, including \n, are ignored */
+    }
+    return EDIT_OK;
+}
@@ -0,0 +1,445 @@
+#include "cli_store.h"
+#include <string.h>
+
+#ifdef CLI_STORE // Otherwise flash pages are never touched, see cli_const.h
+
+/*
+The log occupies two flash pages, only one of them is active. Page layout:
+    [magic:2][generation:2][record][record]...
+Record layout (padded to halfword):
+    [type][key_len][value_len][check][key\0][value\0]
+Lengths include terminating zeroes, so keys and values can be used right
+from flash. Zero value_len means that the entry was deleted. Records are only
+appended, later ones override earlier ones. When the page is full, live records
+are copied to the other page, which gets bigger generation number. Its header is
+written last, so if power is lost during compaction, the old page stays active.
+*/
+
+#define STORE_PAGE_HEADER_LEN 4
+#define STORE_PAGES 2
+
+/* Flash backend */
+
+#ifndef STORE_HOST_FILE
+
+#include <stm32f1xx_hal.h>
+
+static const uint8_t *page_base(uint8_t page)
+{
+    return (const uint8_t*)(STORE_FLASH_ADDR + page * STORE_PAGE_SIZE);
+}
+
+static void flash_unlock(void)
+{
+    HAL_FLASH_Unlock();
+}
+
+static void flash_lock(void)
+{
+    HAL_FLASH_Lock();
+}
+
+static bool flash_program(uint8_t page, unsigned int offset, uint16_t halfword)
+{
+    return HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, \
+        STORE_FLASH_ADDR + page * STORE_PAGE_SIZE + offset, halfword) == HAL_OK;
+}
+
+static bool flash_erase(uint8_t page)
+{
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase = FLASH_TYPEERASE_PAGES,
+        .PageAddress = STORE_FLASH_ADDR + page * STORE_PAGE_SIZE,
+        .NbPages = 1
+    };
+    uint32_t page_error;
+    HAL_FLASH_Unlock();
+    HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &page_error);
+    HAL_FLASH_Lock();
+    return status == HAL_OK;
+}
+
+/* Cycle counter, so that short loads are not measured as zero ticks */
+
+#define STORE_CYCLES_PER_US (SystemCoreClock / 1000000)
+
+static uint32_t store_cycles(void)
+{
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+    return DWT->CYCCNT;
+}
+
+#else
+
+/* File-backed mock for host builds, define STORE_HOST_FILE as file name.
+Behaves like NOR flash: programming can only clear bits. */
+
+#include <stdio.h>
+#include <time.h>
+
+static uint8_t mock[STORE_PAGES][STORE_PAGE_SIZE];
+static bool mock_loaded;
+
+static void mock_save(void)
+{
+    FILE *file = fopen(STORE_HOST_FILE, "wb");
+    if (file == NULL) return;
+    fwrite(mock, 1, sizeof(mock), file);
+    fclose(file);
+}
+
+static const uint8_t *page_base(uint8_t page)
+{
+    if (!mock_loaded) {
+        memset(mock, STORE_EMPTY, sizeof(mock));
+        FILE *file = fopen(STORE_HOST_FILE, "rb");
+        if (file != NULL) {
+            fread(mock, 1, sizeof(mock), file);
+            fclose(file);
+        }
+        mock_loaded = true;
+    }
+    return mock[page];
+}
+
+static void flash_unlock(void)
+{
+}
+
+static void flash_lock(void)
+{
+    mock_save();
+}
+
+static bool flash_program(uint8_t page, unsigned int offset, uint16_t halfword)
+{
+    mock[page][offset] &= halfword & 0xFF;
+    mock[page][offset + 1] &= halfword >> 8;
+    return true;
+}
+
+static bool flash_erase(uint8_t page)
+{
+    memset(mock[page], STORE_EMPTY, STORE_PAGE_SIZE);
+    mock_save();
+    return true;
+}
+
+#define STORE_CYCLES_PER_US 1000 // Nanoseconds are counted instead
+
+static uint32_t store_cycles(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+#endif
+
+/* Service functions */
+
+/* Flash is programmed by halfwords, so writes go through this. */
+
+typedef struct {
+    uint8_t page;
+    unsigned int offset;
+    uint16_t pending;
+    bool odd;
+    bool ok;
+} Writer_t;
+
+static void writer_put(Store_t *store, Writer_t *writer, const void *data, unsigned int len)
+{
+    const uint8_t *point = data;
+    for (unsigned int i = 0; i < len; i++) {
+        if (!writer->odd) {
+            writer->pending = point[i];
+            writer->odd = true;
+            continue;
+        }
+        writer->pending |= point[i] << 8;
+        writer->odd = false;
+        if (!flash_program(writer->page, writer->offset, writer->pending)) writer->ok = false;
+        writer->offset += 2;
+        store->stats.programmed += 2;
+    }
+}
+
+static void writer_flush(Store_t *store, Writer_t *writer)
+{
+    uint8_t pad = STORE_EMPTY;
+    if (writer->odd) writer_put(store, writer, &pad, 1);
+}
+
+static uint8_t checksum(uint8_t type, const uint8_t *key, uint8_t key_len, \
+    const uint8_t *value, uint8_t value_len)
+{
+    uint8_t sum = type + key_len + value_len;
+    for (int i = 0; i < key_len; i++) sum += key[i];
+    for (int i = 0; i < value_len; i++) sum += value[i];
+    return ~sum;
+}
+
+static unsigned int record_len(const uint8_t *rec)
+{
+    return (STORE_HEADER_LEN + rec[1] + rec[2] + 1) & ~1U;
+}
+
+static bool record_valid(const uint8_t *rec, unsigned int offset)
+{
+    if (rec[0] < STORE_CONFIG || rec[0] > STORE_MACRO || rec[1] == 0) return false;
+    if (offset + record_len(rec) > STORE_PAGE_SIZE) return false;
+
+    const uint8_t *key = rec + STORE_HEADER_LEN;
+    const uint8_t *value = key + rec[1];
+    if (key[rec[1] - 1] != '\0' || (rec[2] && value[rec[2] - 1] != '\0')) return false;
+    return checksum(rec[0], key, rec[1], value, rec[2]) == rec[3];
+}
+
+/**
+ * \brief Check if record is not deleted or overridden by one of the later records.
+ */
+static bool record_live(Store_t *store, unsigned int offset)
+{
+    const uint8_t *base = page_base(store->page);
+    const uint8_t *rec = base + offset;
+    if (rec[2] == 0) return false;
+
+    for (offset += record_len(rec); offset < store->end; offset += record_len(base + offset)) {
+        const uint8_t *later = base + offset;
+        if (later[0] == rec[0] && \
+            strcmp((const char*)later + STORE_HEADER_LEN, (const char*)rec + STORE_HEADER_LEN) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool write_page_header(Store_t *store, uint8_t page, uint16_t generation)
+{
+    uint8_t header[STORE_PAGE_HEADER_LEN] = {
+        STORE_MAGIC & 0xFF, STORE_MAGIC >> 8, generation & 0xFF, generation >> 8
+    };
+    Writer_t writer = {.page = page, .offset = 0, .ok = true};
+    flash_unlock();
+    writer_put(store, &writer, header, sizeof(header));
+    flash_lock();
+    return writer.ok;
+}
+
+static Store_Status_t format(Store_t *store, uint8_t page, uint16_t generation)
+{
+    store->stats.erases++;
+    if (!flash_erase(page) || !write_page_header(store, page, generation)) return STORE_ERROR;
+    store->page = page;
+    store->generation = generation;
+    store->end = STORE_PAGE_HEADER_LEN;
+    store->broken = false;
+    return STORE_OK;
+}
+
+/* Basic functions */
+
+/**
+ * \brief Initialize store. Flash is not read until the store is used.
+ * \param[out] store Store object.
+ */
+Store_Status_t Store_Init(Store_t *store)
+{
+    if (store == NULL) return STORE_NULL;
+    memset(store, 0, sizeof(*store));
+    return STORE_OK;
+}
+
+/**
+ * \brief Find active page and the end of the log. Is called on first use.
+ * \retval STORE_ERROR if flash could not be formatted, STORE_OK otherwise.
+ */
+Store_Status_t Store_Load(Store_t *store)
+{
+    if (store == NULL) return STORE_NULL;
+    uint32_t start = store_cycles();
+
+    int active = -1;
+    uint16_t generation = 0;
+    for (int page = 0; page < STORE_PAGES; page++) {
+        const uint8_t *base = page_base(page);
+        if ((base[0] | base[1] << 8) != STORE_MAGIC) continue;
+        uint16_t page_generation = base[2] | base[3] << 8;
+        if (active < 0 || (int16_t)(page_generation - generation) > 0) {
+            active = page;
+            generation = page_generation;
+        }
+    }
+    if (active < 0) { // Never used
+        if (format(store, 0, 1) != STORE_OK) return STORE_ERROR;
+    } else {
+        store->page = active;
+        store->generation = generation;
+        store->broken = false;
+
+        const uint8_t *base = page_base(active);
+        unsigned int offset = STORE_PAGE_HEADER_LEN;
+        while (offset + STORE_HEADER_LEN <= STORE_PAGE_SIZE && base[offset] != STORE_EMPTY) {
+            if (!record_valid(base + offset, offset)) {
+                store->broken = true;
+                break;
+            }
+            offset += record_len(base + offset);
+        }
+        store->end = offset;
+    }
+
+    store->loaded = true;
+    store->stats.load_time = (uint64_t)(store_cycles() - start) * 1000 / STORE_CYCLES_PER_US;
+    return STORE_OK;
+}
+
+/**
+ * \brief Get value of the entry.
+ * \param[in] type Entry type.
+ * \param[in] key Entry name.
+ * \retval Pointer to null-terminated value or NULL if there is no such entry.
+ *  Is valid until the next Store_Put.
+ */
+const char *Store_Get(Store_t *store, Store_Type_t type, const char *key)
+{
+    if (store == NULL || key == NULL) return NULL;
+    if (!store->loaded && Store_Load(store) != STORE_OK) return NULL;
+
+    const uint8_t *base = page_base(store->page);
+    const char *value = NULL;
+    for (unsigned int offset = STORE_PAGE_HEADER_LEN; offset < store->end; \
+        offset += record_len(base + offset)) {
+        const uint8_t *rec = base + offset;
+        if (rec[0] == type && strcmp((const char*)rec + STORE_HEADER_LEN, key) == 0) {
+            value = rec[2] ? (const char*)rec + STORE_HEADER_LEN + rec[1] : NULL;
+        }
+    }
+    return value;
+}
+
+/**
+ * \brief Set value of the entry.
+ * \param[in] type Entry type.
+ * \param[in] key Entry name.
+ * \param[in] value New value, NULL to delete the entry.
+ * \retval STORE_FULL if entry doesn't fit even after compaction, STORE_NOT_FOUND
+ *  if deleted entry does not exist, STORE_ERROR on flash error, STORE_OK otherwise.
+ * \details Nothing is written if value is unchanged.
+ */
+Store_Status_t Store_Put(Store_t *store, Store_Type_t type, const char *key, const char *value)
+{
+    if (store == NULL || key == NULL) return STORE_NULL;
+    if (!store->loaded && Store_Load(store) != STORE_OK) return STORE_ERROR;
+
+    size_t key_len = strlen(key) + 1;
+    size_t value_len = value ? strlen(value) + 1 : 0;
+    if (key_len == 1 || key_len > 0xFF || value_len > 0xFF) return STORE_FULL;
+
+    const char *current = Store_Get(store, type, key);
+    if (value == NULL && current == NULL) return STORE_NOT_FOUND;
+    store->stats.requested += key_len + value_len; // Skipped writes count too
+    if (value != NULL && current != NULL && strcmp(value, current) == 0) return STORE_OK;
+
+    unsigned int len = (STORE_HEADER_LEN + key_len + value_len + 1) & ~1U;
+    if (store->broken || store->end + len > STORE_PAGE_SIZE) {
+        Store_Status_t status = Store_Compact(store);
+        if (status != STORE_OK) return status;
+        if (store->end + len > STORE_PAGE_SIZE) return STORE_FULL;
+    }
+
+    uint8_t header[STORE_HEADER_LEN] = {type, key_len, value_len, \
+        checksum(type, (const uint8_t*)key, key_len, (const uint8_t*)value, value_len)};
+    Writer_t writer = {.page = store->page, .offset = store->end, .ok = true};
+    flash_unlock();
+    writer_put(store, &writer, header, sizeof(header));
+    writer_put(store, &writer, key, key_len);
+    writer_put(store, &writer, value, value_len);
+    writer_flush(store, &writer);
+    flash_lock();
+
+    store->end = writer.offset;
+    if (!writer.ok) {
+        store->broken = true;
+        return STORE_ERROR;
+    }
+    return STORE_OK;
+}
+
+/* Advanced operations */
+
+/**
+ * \brief Copy live entries to the other page and make it active.
+ * \retval STORE_ERROR on flash error, STORE_OK otherwise.
+ */
+Store_Status_t Store_Compact(Store_t *store)
+{
+    if (store == NULL) return STORE_NULL;
+    if (!store->loaded && Store_Load(store) != STORE_OK) return STORE_ERROR;
+
+    uint8_t target = store->page ^ 1;
+    store->stats.erases++;
+    if (!flash_erase(target)) return STORE_ERROR;
+
+    const uint8_t *base = page_base(store->page);
+    Writer_t writer = {.page = target, .offset = STORE_PAGE_HEADER_LEN, .ok = true};
+    flash_unlock();
+    for (unsigned int offset = STORE_PAGE_HEADER_LEN; offset < store->end; \
+        offset += record_len(base + offset)) {
+        if (!record_live(store, offset)) continue;
+        const uint8_t *rec = base + offset;
+        writer_put(store, &writer, rec, STORE_HEADER_LEN + rec[1] + rec[2]);
+        writer_flush(store, &writer);
+    }
+    flash_lock();
+
+    if (!writer.ok || !write_page_header(store, target, store->generation + 1)) return STORE_ERROR;
+    store->page = target;
+    store->generation++;
+    store->end = writer.offset;
+    store->broken = false;
+    return STORE_OK;
+}
+
+/**
+ * \brief Iterate over live entries of given type.
+ * \param[in] offset 0 to start, return value of the previous call to continue.
+ * \param[out] key Entry name.
+ * \param[out] value Entry value.
+ * \retval Offset to continue from, 0 if there are no more entries.
+ */
+unsigned int Store_Next(Store_t *store, Store_Type_t type, unsigned int offset, \
+    const char **key, const char **value)
+{
+    if (store == NULL) return 0;
+    if (!store->loaded && Store_Load(store) != STORE_OK) return 0;
+
+    const uint8_t *base = page_base(store->page);
+    if (offset == 0) offset = STORE_PAGE_HEADER_LEN;
+    for (; offset < store->end; offset += record_len(base + offset)) {
+        const uint8_t *rec = base + offset;
+        if (rec[0] != type || !record_live(store, offset)) continue;
+        *key = (const char*)rec + STORE_HEADER_LEN;
+        *value = *key + rec[1];
+        return offset + record_len(rec);
+    }
+    return 0;
+}
+
+/* Getters/setters */
+
+/**
+ * \brief Get free space in the active page, in bytes.
+ */
+unsigned int Store_GetFree(Store_t *store)
+{
+    if (!store->loaded && Store_Load(store) != STORE_OK) return 0;
+    return STORE_PAGE_SIZE - store->end;
+}
+
+#endif
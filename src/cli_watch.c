@@ -0,0 +1,285 @@
+#include "cli_watch.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Service functions */
+
+/**
+ * \brief Read current value of the variable. Signed types are sign-extended,
+ * so that deltas between two samples are correct.
+ * \param[in] var Watched variable.
+ * \retval Raw value bits.
+ */
+static uint32_t read_raw(Watch_Var_t *var)
+{
+    switch (var->type) {
+        case WATCH_U8:
+            return *(volatile uint8_t*)var->addr;
+        case WATCH_I8:
+            return (uint32_t)(int32_t)*(volatile int8_t*)var->addr;
+        case WATCH_U16:
+            return *(volatile uint16_t*)var->addr;
+        case WATCH_I16:
+            return (uint32_t)(int32_t)*(volatile int16_t*)var->addr;
+        case WATCH_U32:
+        case WATCH_I32:
+        case WATCH_F32:
+        default:
+            return *(volatile uint32_t*)var->addr;
+    }
+}
+
+/**
+ * \brief Append varint to the frame.
+ * \retval Number of bytes written, 0 if it does not fit.
+ */
+static unsigned int put_varint(uint8_t *dst, unsigned int space, uint32_t value)
+{
+    uint8_t tmp[5];
+    unsigned int len = 0;
+    do {
+        tmp[len] = value & 0x7F;
+        value >>= 7;
+        if (value) tmp[len] |= 0x80;
+        len++;
+    } while (value);
+
+    if (len > space) return 0;
+    memcpy(dst, tmp, len);
+    return len;
+}
+
+/**
+ * \brief CRC-8, polynomial 0x07.
+ */
+static uint8_t crc8(const uint8_t *data, unsigned int len)
+{
+    uint8_t crc = 0;
+    for (unsigned int i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint32_t zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+/**
+ * \brief Print value in human-readable form. Floats are printed without %f,
+ * since newlib-nano does not support it by default.
+ * \retval snprintf return value.
+ */
+static int print_value(char *dst, unsigned int space, Watch_Var_t *var, uint32_t raw)
+{
+    switch (var->type) {
+        case WATCH_U8:
+        case WATCH_U16:
+        case WATCH_U32:
+            return snprintf(dst, space, "%s=%lu ", var->name, (unsigned long)raw);
+        case WATCH_F32: {
+            float value;
+            memcpy(&value, &raw, sizeof(value));
+            const char *sign = value < 0 ? "-" : "";
+            if (value < 0) value = -value;
+            /* Cast to integer is undefined for these */
+            if (isnan(value)) return snprintf(dst, space, "%s=nan ", var->name);
+            if (isinf(value)) return snprintf(dst, space, "%s=%sinf ", var->name, sign);
+            if (value >= 4294967296.0f) return snprintf(dst, space, "%s=%sovf ", var->name, sign);
+            unsigned long integer = (unsigned long)value;
+            unsigned long fraction = (unsigned long)((value - integer) * 1000);
+            return snprintf(dst, space, "%s=%s%lu.%03lu ", var->name, sign, integer, fraction);
+        }
+        default:
+            return snprintf(dst, space, "%s=%ld ", var->name, (long)(int32_t)raw);
+    }
+}
+
+static unsigned int encode_text(Watch_t *watch)
+{
+    unsigned int len = 0;
+    for (int i = 0; i < watch->num_vars; i++) {
+        if (!(watch->mask & (1UL << i))) continue;
+        Watch_Var_t *var = &watch->vars[i];
+        uint32_t raw = read_raw(var);
+
+        int written = print_value((char*)watch->frame + len, WATCH_FRAME_LEN - len, var, raw);
+        if (written < 0 || len + written >= WATCH_FRAME_LEN - 1) break;
+        len += written;
+        var->last = raw;
+    }
+    if (len > 0) len--; // Trailing space
+    watch->frame[len++] = '\n';
+    return len;
+}
+
+/*
+Binary frame layout:
+    [sync][len][seq][mask varint][delta varint]...[crc]
+sync is WATCH_SYNC_KEY for keyframes (deltas against zero, all selected variables)
+and WATCH_SYNC_DELTA otherwise (only changed variables, mask tells which).
+len is the number of bytes from seq to the last delta, crc is CRC-8 of len and
+these bytes. Sync values may appear in payload, so the decoder resyncs by
+looking for sync byte, after which len and crc match.
+Deltas are zigzag-encoded, so small negative changes stay short.
+*/
+
+static unsigned int encode_binary(Watch_t *watch)
+{
+    bool key = (watch->seq % WATCH_KEYFRAME_PERIOD) == 0;
+    uint32_t values[MAX_WATCHES];
+    uint32_t changed = 0;
+
+    for (int i = 0; i < watch->num_vars; i++) {
+        if (!(watch->mask & (1UL << i))) continue;
+        values[i] = read_raw(&watch->vars[i]);
+        if (key || values[i] != watch->vars[i].last) changed |= 1UL << i;
+    }
+
+    unsigned int space = WATCH_FRAME_LEN - 1; // CRC
+    unsigned int len = 0;
+    watch->frame[len++] = key ? WATCH_SYNC_KEY : WATCH_SYNC_DELTA;
+    len++; // Length, filled in below
+    watch->frame[len++] = watch->seq;
+    len += put_varint(watch->frame + len, space - len, changed);
+
+    for (int i = 0; i < watch->num_vars; i++) {
+        if (!(changed & (1UL << i))) continue;
+        uint32_t base = key ? 0 : watch->vars[i].last;
+        len += put_varint(watch->frame + len, space - len, zigzag(values[i] - base));
+        watch->vars[i].last = values[i];
+    }
+
+    watch->frame[1] = len - 2;
+    watch->frame[len] = crc8(watch->frame + 1, len - 1);
+    return len + 1;
+}
+
+/* Basic functions */
+
+/**
+ * \brief Initialize watch list.
+ * \param[out] watch Watch list object.
+ */
+Watch_Status_t Watch_Init(Watch_t *watch)
+{
+    if (watch == NULL) return WATCH_NULL;
+    watch->num_vars = 0;
+    watch->mask = 0;
+    watch->active = false;
+    watch->mode = WATCH_TEXT;
+    watch->period = WATCH_DEFAULT_PERIOD;
+    watch->last_tick = 0;
+    watch->seq = 0;
+    watch->frame_len = 0;
+    watch->frame_pos = 0;
+    return WATCH_OK;
+}
+
+/**
+ * \brief Register variable to be watched.
+ * \param[out] watch Watch list object.
+ * \param[in] name Variable name, must outlive the watch list.
+ * \param[in] addr Variable address, must be aligned to its type size.
+ * \param[in] type Variable type, defines its size.
+ * \retval WATCH_FULL if MAX_WATCHES is exceeded, WATCH_UNALIGNED if address is
+ *  not aligned, WATCH_OK otherwise.
+ */
+Watch_Status_t Watch_Register(Watch_t *watch, char name[], volatile void *addr, Watch_Type_t type)
+{
+    if (watch == NULL || name == NULL || addr == NULL) return WATCH_NULL;
+    if (watch->num_vars >= MAX_WATCHES) return WATCH_FULL;
+    if ((uintptr_t)addr % Watch_GetTypeSize(type) != 0) return WATCH_UNALIGNED; // Unaligned reads are not atomic
+
+    Watch_Var_t *var = &watch->vars[watch->num_vars];
+    var->name = name;
+    var->addr = addr;
+    var->type = type;
+    var->last = 0;
+    watch->num_vars++;
+    return WATCH_OK;
+}
+
+/**
+ * \brief Select variable for streaming.
+ * \param[in] name Variable name.
+ * \retval WATCH_NOT_FOUND if there is no such variable, WATCH_OK otherwise.
+ */
+Watch_Status_t Watch_Select(Watch_t *watch, char name[])
+{
+    if (watch == NULL || name == NULL) return WATCH_NULL;
+    for (int i = 0; i < watch->num_vars; i++) {
+        if (strcmp(watch->vars[i].name, name) == 0) {
+            watch->mask |= 1UL << i;
+            return WATCH_OK;
+        }
+    }
+    return WATCH_NOT_FOUND;
+}
+
+/* Advanced operations */
+
+/**
+ * \brief Sample selected variables and encode them into frame.
+ * \retval Frame length.
+ * \details Takes time proportional to the number of selected variables only,
+ *  so it is safe to call from the main loop. Frame is stored in watch->frame,
+ *  it is up to the caller to transmit it.
+ */
+unsigned int Watch_Sample(Watch_t *watch)
+{
+    if (watch->mode == WATCH_BINARY) {
+        watch->frame_len = encode_binary(watch);
+    } else {
+        watch->frame_len = encode_text(watch);
+    }
+    watch->frame_pos = 0;
+    watch->seq++;
+    return watch->frame_len;
+}
+
+/* Getters/setters */
+
+/**
+ * \brief Get size of the variable type in bytes.
+ */
+unsigned int Watch_GetTypeSize(Watch_Type_t type)
+{
+    switch (type) {
+        case WATCH_U8:
+        case WATCH_I8:
+            return 1;
+        case WATCH_U16:
+        case WATCH_I16:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+char *Watch_Type2Str(Watch_Type_t type)
+{
+    switch (type) {
+        case WATCH_U8:
+            return "u8";
+        case WATCH_I8:
+            return "i8";
+        case WATCH_U16:
+            return "u16";
+        case WATCH_I16:
+            return "i16";
+        case WATCH_U32:
+            return "u32";
+        case WATCH_I32:
+            return "i32";
+        case WATCH_F32:
+            return "f32";
+        default:
+            return "unknown";
+    }
+}
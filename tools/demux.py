@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""
+Demultiplexer for bShell built with CLI_MUX.
+
+Device output is split into channels by MUX_ESC (0x10) followed by channel
+number, MUX_ESC in data is doubled. Shell channel goes to the terminal, log and
+telemetry channels go to files. Keystrokes are sent to the device as is.
+
+Usage:
+    demux.py <port> [--baud 115200] [--log log.txt] [--telemetry telemetry.bin]
+    demux.py - < capture.bin     (demultiplex a capture, no keyboard)
+
+Can also be used as a library, see Demux class.
+"""
+
+import argparse
+import os
+import select
+import sys
+
+MUX_ESC = 0x10
+
+CH_SHELL = 0
+CH_LOG = 1
+CH_TELEMETRY = 2
+
+
+class Demux:
+    """Stream parser. Call feed() with received bytes, get (channel, data) pairs."""
+
+    def __init__(self):
+        self.channel = CH_SHELL
+        self.escape = False
+
+    def feed(self, data):
+        out = []
+        chunk = bytearray()
+        for byte in data:
+            if self.escape:
+                self.escape = False
+                if byte == MUX_ESC:
+                    chunk.append(byte)
+                    continue
+                if chunk:
+                    out.append((self.channel, bytes(chunk)))
+                    chunk = bytearray()
+                self.channel = byte
+            elif byte == MUX_ESC:
+                self.escape = True
+            else:
+                chunk.append(byte)
+        if chunk:
+            out.append((self.channel, bytes(chunk)))
+        return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port, or - to read from stdin")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--log", default="log.txt", help="log channel output file")
+    parser.add_argument("--telemetry", default="telemetry.bin", help="telemetry channel output file")
+    args = parser.parse_args()
+
+    outputs = {
+        CH_SHELL: sys.stdout.buffer,
+        CH_LOG: open(args.log, "ab"),
+        CH_TELEMETRY: open(args.telemetry, "ab"),
+    }
+    demux = Demux()
+
+    interactive = args.port != "-"
+
+    def dispatch(data):
+        for channel, payload in demux.feed(data):
+            output = outputs.get(channel)
+            if output is None:
+                continue
+            if interactive and channel == CH_SHELL:
+                payload = payload.replace(b"\n", b"\r\n")  # Terminal is in raw mode
+            output.write(payload)
+            output.flush()
+
+    if not interactive:
+        while True:
+            data = sys.stdin.buffer.read(1024)
+            if not data:
+                return
+            dispatch(data)
+
+    import serial  # pyserial
+    import termios
+    import tty
+
+    port = serial.Serial(args.port, args.baud, timeout=0)
+    stdin = sys.stdin.fileno()
+    saved = termios.tcgetattr(stdin)
+    tty.setraw(stdin)
+    try:
+        while True:
+            ready, _, _ = select.select([port, stdin], [], [])
+            if port in ready:
+                dispatch(port.read(port.in_waiting or 1))
+            if stdin in ready:
+                keys = os.read(stdin, 64)
+                if b"\x1d" in keys:  # Ctrl+], Ctrl+C is sent to the device
+                    return
+                port.write(keys)
+    finally:
+        termios.tcsetattr(stdin, termios.TCSADRAIN, saved)
+
+
+if __name__ == "__main__":
+    main()
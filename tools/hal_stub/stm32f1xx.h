@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * \file
+ * \brief Host stand-in for the CMSIS device header, only what the CLI uses.
+ * See tools/uart_bench.c.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    USART1_IRQn = 37
+} IRQn_Type;
+
+typedef struct {
+    volatile uint32_t SR;
+    volatile uint32_t DR;
+} USART_TypeDef;
@@ -0,0 +1,24 @@
+#pragma once
+
+/**
+ * \file
+ * \brief Host stand-in for the HAL, only what the CLI uses. Functions are
+ * implemented by the bench.
+ */
+#include "stm32f1xx.h"
+
+#define __weak __attribute__((weak))
+#define UNUSED(X) (void)X
+
+typedef enum {
+    HAL_OK,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+uint32_t HAL_GetTick(void);
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn);
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn);
+
+#include "stm32f1xx_hal_uart.h"
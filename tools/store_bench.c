@@ -0,0 +1,70 @@
+/**
+ * \file
+ * \brief Host benchmark for the persistent store: load time and write
+ * amplification under a config update workload.
+ *
+ * Build and run from the repository root:
+ *     gcc -O2 -DCLI_STORE -DSTORE_HOST_FILE='"store_bench.bin"' -Iinclude \
+ *         tools/store_bench.c src/cli_store.c -o store_bench
+ *     ./store_bench [updates]
+ */
+#include "cli_store.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_KEYS 8
+#define BENCH_LOADS 1000
+
+int main(int argc, char *argv[])
+{
+    unsigned long updates = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000;
+    Store_t store;
+    char key[16], value[32];
+    char last[BENCH_KEYS][32] = {{0}}; // Last value of each key
+    unsigned long unchanged = 0;
+
+    remove(STORE_HOST_FILE);
+    Store_Init(&store);
+    if (Store_Load(&store) != STORE_OK) {
+        printf("Error: could not format store\n");
+        return 1;
+    }
+
+    /* Each key is rewritten in turn, every fourth write repeats its last value */
+    for (unsigned long i = 0; i < updates; i++) {
+        char *prev = last[i % BENCH_KEYS];
+        snprintf(key, sizeof(key), "key%lu", i % BENCH_KEYS);
+        if (i % 4 == 3 && prev[0] != '\0') {
+            strcpy(value, prev);
+            unchanged++;
+        } else {
+            snprintf(value, sizeof(value), "%lu", i);
+            strcpy(prev, value);
+        }
+        if (Store_Put(&store, STORE_CONFIG, key, value) != STORE_OK) {
+            printf("Error: write %lu failed\n", i);
+            return 1;
+        }
+    }
+    Store_Put(&store, STORE_ALIAS, "ll", "set");
+    Store_Put(&store, STORE_MACRO, "boot", "set key0;set key1");
+
+    uint32_t load_min = UINT32_MAX;
+    uint64_t load_sum = 0;
+    for (int i = 0; i < BENCH_LOADS; i++) {
+        Store_t probe;
+        Store_Init(&probe);
+        Store_Load(&probe);
+        if (probe.stats.load_time < load_min) load_min = probe.stats.load_time;
+        load_sum += probe.stats.load_time;
+    }
+
+    printf("updates\t%lu\nunchanged\t%lu\nrequested\t%lu\nprogrammed\t%lu\namplification\t%.2f\n" \
+        "erases\t%lu\nfree\t%u\nload min\t%lu ns\nload avg\t%.0f ns\n", updates, unchanged, \
+        (unsigned long)store.stats.requested, (unsigned long)store.stats.programmed, \
+        store.stats.requested ? (double)store.stats.programmed / store.stats.requested : 0.0, \
+        (unsigned long)store.stats.erases, Store_GetFree(&store), (unsigned long)load_min, \
+        (double)load_sum / BENCH_LOADS);
+    return 0;
+}
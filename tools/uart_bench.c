@@ -0,0 +1,208 @@
+/**
+ * \file
+ * \brief Host benchmark for output coalescing: writes, transfers, interrupts,
+ * critical sections and FSM transitions per logical message.
+ *
+ * HAL is replaced with tools/hal_stub and a simulated UART, which sends a byte
+ * every BENCH_BYTE_US and raises TxCplt when the transfer is done. stdout and
+ * stderr are redirected into _write, as newlib does on the device (glibc only).
+ * The same workload is run with transmission started on every write, like before
+ * coalescing, and with coalescing as is. Prints either come in bursts, so UART is
+ * still busy with the previous one, or are spread, so UART goes idle in between.
+ *
+ * Build and run from the repository root (CLI_STORE must be off, -fcommon is for
+ * __cli_primask defined in cli.h):
+ *     gcc -O2 -fcommon -DUSE_CLI -Itools/hal_stub -Iinclude tools/uart_bench.c \
+ *         src/cli.c src/cli_edit.c src/cli_watch.c src/ring_buffer.c -o uart_bench
+ *     ./uart_bench [iterations]
+ */
+#define _GNU_SOURCE
+#include "cli.h"
+
+#define BENCH_BYTE_US 87 // 115200 baud
+#define BENCH_LOOP_US 10000 // Main loop period, UART keeps up with the workload
+#define BENCH_MESSAGES 3 // Logical messages per iteration, see workload()
+
+/* Simulated UART */
+
+static UART_HandleTypeDef huart;
+static USART_TypeDef usart;
+static uint64_t now_us;
+static uint64_t tx_end_us;
+static bool irq_enabled = true;
+static bool in_isr;
+static bool flush_each_write; // Baseline mode
+static uint64_t work_us; // Application work between prints
+static CLI_Context_t ctx;
+
+static struct {
+    uint32_t interrupts;
+    uint32_t bytes;
+} uart_stats;
+
+/**
+ * \brief Let time pass, firing TxCplt for every transfer finished meanwhile,
+ * unless UART interrupt is disabled.
+ */
+static void advance(uint64_t us)
+{
+    uint64_t target = now_us + us;
+    while (irq_enabled && !in_isr && huart.gState == HAL_UART_STATE_BUSY_TX && tx_end_us <= target) {
+        now_us = tx_end_us;
+        huart.gState = HAL_UART_STATE_READY;
+        uart_stats.interrupts++;
+        in_isr = true;
+        HAL_UART_TxCpltCallback(&huart);
+        in_isr = false;
+    }
+    now_us = target;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return now_us / 1000;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    UNUSED(IRQn);
+    irq_enabled = false;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    UNUSED(IRQn);
+    irq_enabled = true;
+    advance(1); // Pending interrupt fires, also lets blocking writes make progress
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+{
+    UNUSED(pData);
+    if (huart->gState != HAL_UART_STATE_READY) return HAL_BUSY;
+    huart->gState = HAL_UART_STATE_BUSY_TX;
+    tx_end_us = now_us + (uint64_t)Size * BENCH_BYTE_US;
+    uart_stats.bytes += Size;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+    UNUSED(huart); UNUSED(pData); UNUSED(Size);
+    return HAL_OK;
+}
+
+HAL_UART_StateTypeDef HAL_UART_GetState(UART_HandleTypeDef *huart)
+{
+    return huart->gState;
+}
+
+/* stdio redirection, one _write per printf like newlib with unbuffered stdout */
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t size)
+{
+    int written = _write((int)(intptr_t)cookie, (uint8_t*)buf, size);
+    if (flush_each_write) CLI_Flush(&ctx);
+    return written < 0 ? 0 : written;
+}
+
+static FILE *open_stream(int fd)
+{
+    cookie_io_functions_t io = {.write = cookie_write};
+    return fopencookie((void*)(intptr_t)fd, "w", io);
+}
+
+/* Workload */
+
+static void loop(void)
+{
+}
+
+/**
+ * \brief One main loop iteration: a line printed in pieces, a log entry and
+ * a status line, BENCH_MESSAGES logical messages in total.
+ */
+static void workload(unsigned long i)
+{
+    printf("t=%lu ", (unsigned long)HAL_GetTick());
+    advance(work_us);
+    printf("adc=%lu ", i % 4096);
+    advance(work_us);
+    printf("ok\n");
+    advance(work_us);
+    CLI_Log(&ctx, "bench", "sample logged");
+    advance(work_us);
+    CLI_Println(&ctx, "status: running");
+    CLI_RUN(&ctx, loop);
+    advance(BENCH_LOOP_US);
+}
+
+typedef struct {
+    double writes, transfers, interrupts, criticals, transitions, bytes;
+} Result_t;
+
+/**
+ * \brief Run the workload from a fresh context.
+ * \param[in] baseline Start transmission on every write, as before coalescing.
+ * \param[in] gap Application work between prints, us.
+ * \retval Counters per logical message, bytes per transfer.
+ */
+static Result_t run(bool baseline, uint64_t gap, unsigned long iterations)
+{
+    flush_each_write = baseline;
+    work_us = gap;
+    CLI_Init(&ctx, &huart);
+    while (huart.gState != HAL_UART_STATE_READY) advance(BENCH_BYTE_US);
+
+    memset(&ctx.stats, 0, sizeof(ctx.stats));
+    memset(&uart_stats, 0, sizeof(uart_stats));
+    for (unsigned long i = 0; i < iterations; i++) workload(i);
+    while (huart.gState != HAL_UART_STATE_READY) advance(BENCH_BYTE_US);
+
+    double messages = (double)iterations * BENCH_MESSAGES;
+    Result_t result = {
+        .writes = ctx.stats.writes / messages,
+        .transfers = ctx.stats.transfers / messages,
+        .interrupts = uart_stats.interrupts / messages,
+        .criticals = ctx.stats.criticals / messages,
+        .transitions = ctx.stats.transitions / messages,
+        .bytes = ctx.stats.transfers ? (double)uart_stats.bytes / ctx.stats.transfers : 0
+    };
+    return result;
+}
+
+static void report(FILE *out, const char *name, Result_t *result)
+{
+    fprintf(out, "%-10s %8.2f %10.2f %11.2f %10.2f %12.2f %15.1f\n", name, result->writes, \
+        result->transfers, result->interrupts, result->criticals, result->transitions, \
+        result->bytes);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000;
+    FILE *out = stdout; // Real stdout, CLI output goes to the simulated UART
+    huart.Instance = &usart;
+    huart.gState = HAL_UART_STATE_READY;
+    stdout = open_stream(STDOUT_FILENO);
+    stderr = open_stream(STDERR_FILENO);
+
+    const struct {
+        const char *name;
+        uint64_t gap;
+    } scenarios[] = {{"burst", 20}, {"spread", 1000}};
+
+    fprintf(out, "%lu iterations, %d messages each, counters per message\n", \
+        iterations, BENCH_MESSAGES);
+    for (unsigned int i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        Result_t baseline = run(true, scenarios[i].gap, iterations);
+        Result_t coalesced = run(false, scenarios[i].gap, iterations);
+        fprintf(out, "\n%s, %lu us between prints:\n", scenarios[i].name, \
+            (unsigned long)scenarios[i].gap);
+        fprintf(out, "%-10s %8s %10s %11s %10s %12s %15s\n", "mode", "writes", "transfers", \
+            "interrupts", "criticals", "transitions", "bytes/transfer");
+        report(out, "baseline", &baseline);
+        report(out, "coalesced", &coalesced);
+    }
+    return 0;
+}